@@ -1,12 +1,17 @@
 #include <errno.h> /* error codes */
+#include <fcntl.h> /* open() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> /* malloc() */
-#include <unistd.h> /* read() */
+#include <time.h>   /* clock_gettime() */
+#include <unistd.h> /* pread() */
 
 #include <alsa/asoundlib.h>
 
+#include "alsa_play.h"
 #include "ftrace.h"
+#include "resample.h"
+#include "results.h"
 
 /*
  * PCM device name.
@@ -26,6 +31,9 @@
 #define NUM_CHANNELS 2
 #define FRAME_SIZE (SAMPLE_SIZE * NUM_CHANNELS)
 
+/* requested playback rate in Hz, wav files at other rates are resampled */
+#define PCM_RATE 48000
+
 /*
  * ALSA specifies period and buffer size in frames. Sample format, playback
  * rate, and period size determine interrupt period and latency.
@@ -48,18 +56,67 @@
 #define BUFFER_SIZE (3 * PERIOD_SIZE)
 
 /*
- * The Microsoft WAV PCM soundfile format has a 44 bytes header.
- * We'll just skip past this header with a hardcoded offset when accessing PCM
- * data.
+ * The Microsoft WAV PCM soundfile format is a RIFF header followed by chunks,
+ * each with a 4 character id and a 32-bit little endian size. We need the
+ * "fmt " chunk for the sample rate and format, and the "data" chunk.
+ */
+#define RIFF_HEADER 12
+#define CHUNK_HEADER 8
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+/*
+ * An extensible fmt chunk carries the real format in the first two bytes of
+ * its SubFormat GUID, after a 22 byte extension that follows the 16 byte
+ * basic format.
  */
-#define WAV_HEADER 44
+#define WAV_FMT_SIZE 16
+#define WAV_EXTENSION_SIZE 22
+#define WAV_SUBFORMAT_OFFSET 24
 
 /* pcm handle */
 static snd_pcm_t *pcm_handle;
 
+/* byte offset of the next frame to deliver */
+static long play_index;
+
+/* underruns seen while playing */
+static unsigned int xrun_count;
+
+/* frames queued by the most recent snd_pcm_writei() */
+static snd_pcm_sframes_t last_written;
+
+/* parameters negotiated with the PCM device */
+static struct alsa_params pcm_params;
+
 /* audio sample data */
 long wav_size;
 char *wav_buffer;
+static unsigned int wav_rate;
+
+/* wav file, open until its samples are loaded or for as long as it streams */
+static int wav_fd = -1;
+static long wav_data_offset;
+
+/*
+ * Streaming resampler state. Instead of loading and converting the whole file
+ * up front, input is read from the file a block at a time and one period is
+ * resampled into period_buffer just before it is written. The first block is
+ * kept in stream_head, so starting a play never has to touch the file.
+ */
+#define STREAM_BLOCK_FRAMES 4096
+
+static struct resampler *stream_resampler;
+static char *period_buffer;
+static char *stream_head;     /* first block of the file */
+static long stream_head_size; /* bytes in stream_head */
+static char *stream_block;    /* later blocks, read as the stream needs them */
+static char *stream_in;       /* block being resampled */
+static long stream_in_frames; /* frames in stream_in */
+static long stream_in_used;   /* frames of stream_in already resampled */
+static long period_frames;    /* frames resampled but not yet written */
+static long stream_out_done;  /* frames written since alsa_start() */
+static long stream_out_total; /* length of the whole file after resampling */
 
 int pcm_set_sw_params(snd_pcm_t *handle, snd_pcm_sw_params_t *params, int period)
 {
@@ -109,6 +166,8 @@ int pcm_set_sw_params(snd_pcm_t *handle, snd_pcm_sw_params_t *params, int period
         return ret;
     }
     printf("Start threshold is %lu frames\n", threshold);
+    pcm_params.start_threshold = threshold;
+    pcm_params.avail_min = period_size;
 
     return 0;
 }
@@ -235,7 +294,7 @@ int pcm_set_hw_params(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int period
     }
 
     /* set playback rate */
-    requested_rate = set_rate = 48000; // 48 kHz
+    requested_rate = set_rate = PCM_RATE; // 48 kHz
     ret = snd_pcm_hw_params_set_rate_near(handle, params, &set_rate, 0);
     if (ret) {
         fprintf(stderr, "Rate no available for playback: %s\n",
@@ -243,12 +302,14 @@ int pcm_set_hw_params(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int period
         return ret;
     }
     if (set_rate != requested_rate) {
-        fprintf(stderr,
-                "Set rate ( %u Hz ) does not match requested rate ( %u Hz )\n",
-                set_rate, requested_rate);
-        return -EINVAL;
+        printf("Set rate ( %u Hz ) does not match requested rate ( %u Hz )\n",
+               set_rate, requested_rate);
     }
 
+    pcm_params.format = snd_pcm_format_name(SND_PCM_FORMAT_S32_LE);
+    pcm_params.channels = NUM_CHANNELS;
+    pcm_params.rate = set_rate;
+
     pcm_print_hw_params(params);
 
     /* set period size */
@@ -288,6 +349,7 @@ int pcm_set_hw_params(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int period
         fprintf(stderr, "Can't get period size\n");
     }
     printf("Actual period size = %lu\n", period_size);
+    pcm_params.period_size = period_size;
 
     /* get period time */
     unsigned int period_time;
@@ -296,6 +358,7 @@ int pcm_set_hw_params(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int period
         fprintf(stderr, "Can't get period time\n");
     }
     printf("Actual period time = % f\n", period_time / 1000.0);
+    pcm_params.period_time_us = period_time;
 
     /* get buffer size */
     ret = snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
@@ -303,6 +366,7 @@ int pcm_set_hw_params(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int period
         fprintf(stderr, "Can't get buffer size\n");
     }
     printf("Actual buffer size = %lu\n", buffer_size);
+    pcm_params.buffer_size = buffer_size;
 
     return 0;
 }
@@ -321,123 +385,499 @@ static void show_available_sample_formats(snd_pcm_t *handle,
     printf("\n");
 }
 
-int alsa_play(void)
+/*
+ * Rewind to the start of the PCM data and make sure the device is ready to
+ * accept a new stream. A previous stream may have been stopped midway or may
+ * have run dry after the end of file, so drop whatever is left and prepare.
+ */
+int alsa_start(void)
 {
     int ret;
-    static int index = WAV_HEADER; // skip header and start at PCM data
-    snd_pcm_sframes_t frames_requested, frames_written;
 
-    while (1) {
-        ret = snd_pcm_wait(pcm_handle, 1000);
-        if (ret == 0) {
-            fprintf(stderr, "PCM timeout occurred\n");
-            return -1;
-        } else if (ret < 0) {
-            fprintf(stderr, "PCM device error: %s\n", snd_strerror(ret));
-            return ret;
-        }
+    play_index = 0;
+
+    if (stream_resampler) {
+        resampler_reset(stream_resampler);
+        stream_in = stream_head;
+        stream_in_frames = stream_head_size / FRAME_SIZE;
+        stream_in_used = 0;
+        play_index = stream_head_size;
+        period_frames = 0;
+        stream_out_done = 0;
+    }
+
+    if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED)
+        return 0;
 
-        frames_requested = snd_pcm_avail_update(pcm_handle);
-        if (frames_requested < 0) {
-            fprintf(stderr, "PCM error requesting frames: %s\n",
-                    snd_strerror(ret));
-            return ret;
+    snd_pcm_drop(pcm_handle);
+    ret = snd_pcm_prepare(pcm_handle);
+    if (ret < 0) {
+        fprintf(stderr, "Can't prepare PCM device: %s\n", snd_strerror(ret));
+        return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the next block of the wav file into stream_block. In stream mode
+ * play_index is the file position, relative to the start of the PCM data.
+ * Returns the number of frames read, 0 at end of file.
+ */
+static long stream_read_block(void)
+{
+    ssize_t bytes;
+
+    bytes = wav_size - play_index;
+    if (bytes > STREAM_BLOCK_FRAMES * FRAME_SIZE)
+        bytes = STREAM_BLOCK_FRAMES * FRAME_SIZE;
+    if (bytes <= 0)
+        return 0;
+
+    bytes = pread(wav_fd, stream_block, bytes, wav_data_offset + play_index);
+    if (bytes < 0) {
+        fprintf(stderr, "Error reading wave file: %s\n", strerror(errno));
+        return 0;
+    }
+    bytes -= bytes % FRAME_SIZE;
+    play_index += bytes;
+
+    stream_in = stream_block;
+    stream_in_frames = bytes / FRAME_SIZE;
+    stream_in_used = 0;
+
+    return stream_in_frames;
+}
+
+/* resample up to 'frames' of the wav file into the period buffer */
+static long stream_period(long frames)
+{
+    long used, produced = 0;
+
+    if (frames > stream_out_total - stream_out_done)
+        frames = stream_out_total - stream_out_done;
+
+    while (produced < frames) {
+        /* out of input, flush what is left in the filter */
+        if (stream_in_used == stream_in_frames && stream_read_block() == 0) {
+            produced += resampler_process(
+                stream_resampler, NULL, 0, NULL,
+                (int32_t *)period_buffer + produced * NUM_CHANNELS,
+                frames - produced);
+            break;
         }
 
-        /* deliver data one period at a time */
-        frames_requested =
-            (frames_requested > PERIOD_SIZE) ? PERIOD_SIZE : frames_requested;
+        produced += resampler_process(
+            stream_resampler,
+            (int32_t *)stream_in + stream_in_used * NUM_CHANNELS,
+            stream_in_frames - stream_in_used, &used,
+            (int32_t *)period_buffer + produced * NUM_CHANNELS,
+            frames - produced);
+        stream_in_used += used;
+    }
+
+    return produced;
+}
+
+/*
+ * Deliver at most one period of audio to the PCM device.
+ * Returns 1 while there is audio left to play, 0 at end of file and a
+ * negative error code on failure.
+ */
+int alsa_play_period(void)
+{
+    int ret, eof;
+    char *frames;
+    snd_pcm_sframes_t frames_requested, frames_written;
+
+    last_written = 0;
+
+    ret = snd_pcm_wait(pcm_handle, 1000);
+    if (ret == 0) {
+        fprintf(stderr, "PCM timeout occurred\n");
+        return -1;
+    } else if (ret < 0) {
+        fprintf(stderr, "PCM device error: %s\n", snd_strerror(ret));
+        return ret;
+    }
+
+    frames_requested = snd_pcm_avail_update(pcm_handle);
+    if (frames_requested < 0) {
+        fprintf(stderr, "PCM error requesting frames: %s\n",
+                snd_strerror(frames_requested));
+        return frames_requested;
+    }
+
+    /* deliver data one period at a time */
+    frames_requested =
+        (frames_requested > PERIOD_SIZE) ? PERIOD_SIZE : frames_requested;
 
+    if (stream_resampler) {
+        /* resample a new period only once the last one has been written */
+        if (period_frames == 0)
+            period_frames = stream_period(frames_requested);
+        frames_requested = period_frames;
+        frames = period_buffer;
+    } else {
         /* don't overrun wav file buffer */
-        frames_requested = (frames_requested * FRAME_SIZE + index > wav_size)
-                               ? (wav_size - index) / FRAME_SIZE
-                               : frames_requested;
+        frames_requested =
+            (frames_requested * FRAME_SIZE + play_index > wav_size)
+                ? (wav_size - play_index) / FRAME_SIZE
+                : frames_requested;
+        frames = &wav_buffer[play_index];
+    }
 
 #ifdef FTRACE
-        trace_start("START_TRACE\n");
+    trace_start("START_TRACE\n");
 #endif
-        frames_written =
-            snd_pcm_writei(pcm_handle, &wav_buffer[index], frames_requested);
+    frames_written = snd_pcm_writei(pcm_handle, frames, frames_requested);
 #ifdef FTRACE
-        trace_stop("STOP_TRACE\n");
+    trace_stop("STOP_TRACE\n");
 #endif
 
-        if (frames_written == -EAGAIN) {
-            continue;
-        }
+    if (frames_written > 0)
+        last_written = frames_written;
+
+    if (frames_written == -EAGAIN) {
+        return 1;
+    }
 
-        if (frames_written == -EPIPE) { // underrun
-            fprintf(stderr, "PCM write error: Underrun event\n");
+    if (frames_written == -EPIPE) { // underrun
+        fprintf(stderr, "PCM write error: Underrun event\n");
+        xrun_count++;
+        frames_written = snd_pcm_prepare(pcm_handle);
+        if (frames_written < 0) {
+            fprintf(stderr,
+                    "Can't recover from underrun, prepare failed: %s\n",
+                    snd_strerror(frames_written));
+            return frames_written;
+        }
+    } else if (frames_written == -ESTRPIPE) {
+        fprintf(stderr, "PCM write error: Stream is suspended\n");
+        while ((frames_written = snd_pcm_resume(pcm_handle)) == -EAGAIN) {
+            sleep(1); // wait until the suspend flag is released
+        }
+        if (frames_written < 0) {
             frames_written = snd_pcm_prepare(pcm_handle);
             if (frames_written < 0) {
                 fprintf(stderr,
-                        "Can't recover from underrun, prepare failed: %s\n",
+                        "Can' recover from suspend, prepare failed: %s\n",
                         snd_strerror(frames_written));
                 return frames_written;
             }
-        } else if (frames_written == -ESTRPIPE) {
-            fprintf(stderr, "PCM write error: Stream is suspended\n");
-            while ((frames_written = snd_pcm_resume(pcm_handle)) == -EAGAIN) {
-                sleep(1); // wait until the suspend flag is released
-            }
-            if (frames_written < 0) {
-                frames_written = snd_pcm_prepare(pcm_handle);
-                if (frames_written < 0) {
-                    fprintf(stderr,
-                            "Can' recover from suspend, prepare failed: %s\n",
-                            snd_strerror(frames_written));
-                    return frames_written;
-                }
-            }
         }
+    }
+
+    /* update current index */
+    if (stream_resampler) {
+        period_frames = 0;
+        stream_out_done += frames_requested;
+        eof = stream_out_done >= stream_out_total;
+    } else {
+        play_index += frames_requested * FRAME_SIZE;
+        eof = play_index >= wav_size;
+    }
+
+    if (eof) {
+        printf("End of file\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/* abort the current stream, discarding any frames still queued */
+void alsa_stop(void)
+{
+    snd_pcm_drop(pcm_handle);
+    snd_pcm_prepare(pcm_handle);
+    play_index = wav_size;
+    stream_out_done = stream_out_total;
+}
+
+/*
+ * Fill in the PCM's poll descriptors so a caller can wait on the device
+ * together with its own file descriptors. Returns the number filled in.
+ */
+int alsa_poll_descriptors(struct pollfd *pfds, unsigned int space)
+{
+    int ret;
+
+    ret = snd_pcm_poll_descriptors(pcm_handle, pfds, space);
+    if (ret < 0)
+        fprintf(stderr, "Can't get PCM poll descriptors: %s\n",
+                snd_strerror(ret));
+
+    return ret;
+}
+
+/*
+ * After poll() returns, check whether the PCM wants more frames.
+ * POLLERR counts as ready so alsa_play_period() gets to recover the xrun.
+ */
+int alsa_poll_ready(struct pollfd *pfds, unsigned int count)
+{
+    int ret;
+    unsigned short revents;
+
+    ret = snd_pcm_poll_descriptors_revents(pcm_handle, pfds, count, &revents);
+    if (ret < 0)
+        return ret;
+
+    return (revents & (POLLOUT | POLLERR)) != 0;
+}
+
+/*
+ * Command-to-sound latency of a stream whose first period was just written by
+ * alsa_play_period(): the time since 'start', plus how long the frames queued
+ * ahead of that period take to reach the DAC. snd_pcm_delay() counts the
+ * period just written as well, but its first frame isn't behind itself, so it
+ * is taken off again.
+ */
+long alsa_latency_us(struct timespec *start)
+{
+    struct timespec now;
+    snd_pcm_sframes_t delay;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (snd_pcm_delay(pcm_handle, &delay) < 0 || delay < last_written)
+        delay = 0;
+    else
+        delay -= last_written;
+
+    return elapsed_us(start, &now) + delay * 1000000L / pcm_params.rate;
+}
+
+/* number of underruns seen since alsa_init() */
+unsigned int alsa_xruns(void)
+{
+    return xrun_count;
+}
+
+/* hardware and software parameters as negotiated by alsa_init() */
+const struct alsa_params *alsa_get_params(void)
+{
+    return &pcm_params;
+}
+
+static unsigned int le16(const char *p)
+{
+    return (unsigned char)p[0] | (unsigned char)p[1] << 8;
+}
+
+static unsigned long le32(const char *p)
+{
+    return le16(p) | (unsigned long)le16(p + 2) << 16;
+}
+
+/*
+ * Walk the RIFF chunks of the open wav file and check the sample format.
+ * Only the headers are read; the PCM data is left in the file, at
+ * wav_data_offset, until load_wav_data() or the streaming resampler needs it.
+ */
+static int parse_wav_header(long file_size)
+{
+    long offset = RIFF_HEADER, data_offset = -1;
+    unsigned long chunk_size, avail, data_size = 0;
+    unsigned int format = 0, channels = 0, bits = 0;
+    char header[RIFF_HEADER];
+    char fmt[WAV_FMT_SIZE + 2 + WAV_EXTENSION_SIZE];
+
+    if (pread(wav_fd, header, RIFF_HEADER, 0) != RIFF_HEADER ||
+        memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+        fprintf(stderr, "Not a RIFF WAVE file\n");
+        return -EINVAL;
+    }
 
-        /* update current index */
-        index += frames_requested * FRAME_SIZE;
+    while (offset + CHUNK_HEADER <= file_size) {
+        if (pread(wav_fd, header, CHUNK_HEADER, offset) != CHUNK_HEADER)
+            break;
+        chunk_size = le32(header + 4);
+        avail = file_size - offset - CHUNK_HEADER;
 
-        if (index >= wav_size) {
-            printf("End of file\n");
-            return 0;
+        /* a truncated file still plays what it has */
+        if (!memcmp(header, "data", 4)) {
+            data_offset = offset + CHUNK_HEADER;
+            data_size = (chunk_size > avail) ? avail : chunk_size;
+            break;
         }
 
-#ifdef FTRACE
-        exit(-1); // bail after one write
-#endif
+        /* any other chunk must fit in the file before we read or skip it */
+        if (chunk_size > avail)
+            break;
+
+        if (!memcmp(header, "fmt ", 4) && chunk_size >= WAV_FMT_SIZE) {
+            if (pread(wav_fd, fmt,
+                      (chunk_size < sizeof fmt) ? chunk_size : sizeof fmt,
+                      offset + CHUNK_HEADER) < WAV_FMT_SIZE)
+                break;
+            format = le16(fmt);
+            channels = le16(fmt + 2);
+            wav_rate = le32(fmt + 4);
+            bits = le16(fmt + 14);
+
+            /* IEEE float is often extensible too, only accept PCM inside */
+            if (format == WAV_FORMAT_EXTENSIBLE) {
+                if (chunk_size >= sizeof fmt &&
+                    le16(fmt + WAV_FMT_SIZE) >= WAV_EXTENSION_SIZE)
+                    format = le16(fmt + WAV_SUBFORMAT_OFFSET);
+                else
+                    format = 0;
+            }
+        }
+        offset += CHUNK_HEADER + chunk_size + (chunk_size & 1); // word aligned
     }
 
-    return -1; // we should never get here
+    if (data_offset < 0 || wav_rate == 0) {
+        fprintf(stderr, "Wave file is missing its fmt or data chunk\n");
+        return -EINVAL;
+    }
+    if (format != WAV_FORMAT_PCM || channels != NUM_CHANNELS || bits != SAMPLE_SIZE * 8) {
+        fprintf(stderr, "Wave file must be %d-bit %d channel PCM\n",
+                SAMPLE_SIZE * 8, NUM_CHANNELS);
+        return -EINVAL;
+    }
+
+    wav_data_offset = data_offset;
+    wav_size = data_size - data_size % FRAME_SIZE;
+
+    printf("Wave file rate %u Hz, %ld frames\n", wav_rate,
+           wav_size / FRAME_SIZE);
+
+    return 0;
 }
 
+/* open the wav file and parse its header, leaving the samples on disk */
 int read_wav_file(char *wav_file)
 {
     int ret;
-    FILE *wav_fd;
+    long file_size;
+
+    wav_fd = open(wav_file, O_RDONLY);
+    if (wav_fd < 0) {
+        fprintf(stderr, "Cannot open wave file %s: %s\n", wav_file,
+                strerror(errno));
+        return -errno;
+    }
+    file_size = lseek(wav_fd, 0, SEEK_END);
 
-    /* open wave file and get size */
-    wav_fd = fopen(wav_file, "rb");
-    fseek(wav_fd, 0, SEEK_END);
-    wav_size = ftell(wav_fd);
-    rewind(wav_fd);
+    ret = parse_wav_header(file_size);
+    if (ret) {
+        close(wav_fd);
+        wav_fd = -1;
+        return ret;
+    }
+
+    return 0;
+}
+
+/* read all samples of the wav file into wav_buffer and close it */
+static int load_wav_data(void)
+{
+    int ret = 0;
 
     /* allocate a buffer for audio samples and fill it */
-    wav_buffer = malloc(wav_size);
+    wav_buffer = malloc(wav_size ? wav_size : 1);
     if (!wav_buffer) {
         ret = -ENOMEM;
         fprintf(stderr, "Cannot allocate audio sample buffer: %s\n",
-                strerror(ret));
-        return ret;
-    }
-    if (fread(wav_buffer, 1, wav_size, wav_fd) != wav_size) {
+                strerror(-ret));
+    } else if (pread(wav_fd, wav_buffer, wav_size, wav_data_offset) !=
+               wav_size) {
         ret = -1;
         fprintf(stderr, "Error reading wave file\n");
         free(wav_buffer);
-        return ret;
+        wav_buffer = NULL;
+    }
+
+    close(wav_fd);
+    wav_fd = -1;
+
+    return ret;
+}
+
+/* convert the whole wav file to the device rate up front */
+static int resample_wav_buffer(int quality)
+{
+    struct resampler *r;
+    struct timespec start, end;
+    long in_frames, out_frames, produced;
+    char *out;
+
+    r = resampler_create(wav_rate, pcm_params.rate, NUM_CHANNELS, quality);
+    if (!r)
+        return -EINVAL;
+
+    in_frames = wav_size / FRAME_SIZE;
+    out_frames = resampler_output_frames(r, in_frames);
+    out = malloc(out_frames * FRAME_SIZE);
+    if (!out) {
+        fprintf(stderr, "Cannot allocate resampled sample buffer: %s\n",
+                strerror(ENOMEM));
+        resampler_free(r);
+        return -ENOMEM;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    produced = resampler_process(r, (int32_t *)wav_buffer, in_frames, NULL,
+                                 (int32_t *)out, out_frames);
+    resampler_process(r, NULL, 0, NULL,
+                      (int32_t *)out + produced * NUM_CHANNELS,
+                      out_frames - produced);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Resampled %u Hz -> %u Hz in %.1f ms\n", wav_rate, pcm_params.rate,
+           (end.tv_sec - start.tv_sec) * 1000.0 +
+               (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+    resampler_free(r);
+    free(wav_buffer);
+    wav_buffer = out;
+    wav_size = out_frames * FRAME_SIZE;
+
+    return 0;
+}
+
+/*
+ * Set up per-period resampling from the wav file to the device rate. Only the
+ * first block of samples is read now, the rest as the stream plays.
+ */
+static int stream_init(int quality)
+{
+    stream_resampler =
+        resampler_create(wav_rate, pcm_params.rate, NUM_CHANNELS, quality);
+    if (!stream_resampler)
+        return -EINVAL;
+
+    stream_head_size = wav_size;
+    if (stream_head_size > STREAM_BLOCK_FRAMES * FRAME_SIZE)
+        stream_head_size = STREAM_BLOCK_FRAMES * FRAME_SIZE;
+
+    period_buffer = malloc(PERIOD_SIZE * FRAME_SIZE);
+    stream_head = malloc(STREAM_BLOCK_FRAMES * FRAME_SIZE);
+    stream_block = malloc(STREAM_BLOCK_FRAMES * FRAME_SIZE);
+    if (!period_buffer || !stream_head || !stream_block) {
+        fprintf(stderr, "Cannot allocate stream buffers: %s\n",
+                strerror(ENOMEM));
+        return -ENOMEM;
+    }
+
+    if (pread(wav_fd, stream_head, stream_head_size, wav_data_offset) !=
+        stream_head_size) {
+        fprintf(stderr, "Error reading wave file\n");
+        return -1;
     }
-    fclose(wav_fd);
+
+    stream_out_total =
+        resampler_output_frames(stream_resampler, wav_size / FRAME_SIZE);
+    printf("Streaming resampler %u Hz -> %u Hz\n", wav_rate, pcm_params.rate);
 
     return 0;
 }
 
-int alsa_init(char *device_name, char *wav_file, int period)
+int alsa_init(char *device_name, char *wav_file, int period, int quality,
+              int stream)
 {
     /* return values / errors */
     int ret;
@@ -496,6 +936,19 @@ int alsa_init(char *device_name, char *wav_file, int period)
 
     /* print some hardware info */
     printf("PCM device name: %s\n", snd_pcm_name(pcm_handle));
+    pcm_params.device = snd_pcm_name(pcm_handle);
+
+    /* bring the wav file to the negotiated rate */
+    if (stream && wav_rate != pcm_params.rate) {
+        ret = stream_init(quality);
+    } else {
+        ret = load_wav_data();
+        if (!ret && wav_rate != pcm_params.rate)
+            ret = resample_wav_buffer(quality);
+    }
+    if (ret) {
+        return ret;
+    }
 
 #ifdef FTRACE
     return trace_init();
@@ -509,4 +962,10 @@ void alsa_deinit(void)
     snd_pcm_drain(pcm_handle);
     snd_pcm_close(pcm_handle);
     free(wav_buffer);
+    resampler_free(stream_resampler);
+    free(period_buffer);
+    free(stream_head);
+    free(stream_block);
+    if (wav_fd >= 0)
+        close(wav_fd);
 }
@@ -1,8 +1,32 @@
 #ifndef ALSA_PLAY_H
 #define ALSA_PLAY_H
 
-int alsa_play(void);
-int alsa_init(char *device_name, char *wav_file, int period);
+#include <poll.h>
+#include <time.h>
+
+/* hardware and software parameters negotiated with the PCM device */
+struct alsa_params {
+    const char *device;
+    const char *format;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned long period_size;
+    unsigned long buffer_size;
+    unsigned int period_time_us;
+    unsigned long avail_min;
+    unsigned long start_threshold;
+};
+
+int alsa_start(void);
+int alsa_play_period(void);
+void alsa_stop(void);
+int alsa_poll_descriptors(struct pollfd *pfds, unsigned int space);
+int alsa_poll_ready(struct pollfd *pfds, unsigned int count);
+long alsa_latency_us(struct timespec *start);
+unsigned int alsa_xruns(void);
+const struct alsa_params *alsa_get_params(void);
+int alsa_init(char *device_name, char *wav_file, int period, int quality,
+              int stream);
 void alsa_deinit(void);
 
 #endif /* ALSA_PLAY_H */
@@ -0,0 +1,350 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+ * Compare two result files written by latency-test -o and flag a latency
+ * regression in the second one.
+ *
+ * A regression needs both statistical significance and practical size: a
+ * one-sided Mann-Whitney U test must find the candidate latencies larger at
+ * the given significance level, and the candidate median must have grown by
+ * at least the given threshold. The rank test makes no assumption about the
+ * shape of the latency distribution, which is usually skewed by a long tail.
+ *
+ * The tail is gated separately, since it can blow up while the median stays
+ * put: more candidate triggers must land above the baseline p99 than the
+ * baseline's own share, and the p99 must have grown by the tail threshold.
+ * Underruns per trigger are compared the same way, and any underrun in the
+ * candidate is a regression when the baseline had none.
+ *
+ * Exit status is 0 when there is no regression, 1 on regression and 2 on
+ * error, so the tool can gate a rollout directly.
+ */
+
+/* fewer samples than this can't reach significance with the normal approx */
+#define MIN_SAMPLES 8
+
+#define DEFAULT_ALPHA 0.05
+#define DEFAULT_THRESHOLD 5.0 // percent
+#define DEFAULT_TAIL_THRESHOLD 10.0 // percent
+
+struct result {
+    char *path;
+    long *latencies;
+    unsigned int count;
+    unsigned int xruns;
+};
+
+struct rank {
+    long value;
+    int candidate;
+};
+
+static int compare_rank(const void *a, const void *b)
+{
+    return stats_compare_long(&((const struct rank *)a)->value,
+                              &((const struct rank *)b)->value);
+}
+
+static char *read_file(char *path)
+{
+    FILE *fp;
+    long size;
+    char *text;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+
+    text = malloc(size + 1);
+    if (!text) {
+        fprintf(stderr, "Cannot allocate buffer for %s\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    if (fread(text, 1, size, fp) != size) {
+        fprintf(stderr, "Error reading %s\n", path);
+        free(text);
+        fclose(fp);
+        return NULL;
+    }
+    text[size] = '\0';
+    fclose(fp);
+
+    return text;
+}
+
+/*
+ * Pull the per-trigger latencies and underruns out of the "triggers" array.
+ * This only understands the layout written by results_write().
+ */
+static int read_result(struct result *res)
+{
+    char *text, *p, *end, *key;
+    unsigned int capacity = 0;
+    long *l;
+
+    text = read_file(res->path);
+    if (!text)
+        return -1;
+
+    p = strstr(text, "\"triggers\"");
+    if (!p || !(p = strchr(p, '[')) || !(end = strchr(p, ']'))) {
+        fprintf(stderr, "No triggers array in %s\n", res->path);
+        free(text);
+        return -1;
+    }
+    *end = '\0';
+
+    while ((key = strstr(p, "\"latency_us\":")) != NULL) {
+        if (res->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            l = realloc(res->latencies, capacity * sizeof *l);
+            if (!l) {
+                fprintf(stderr, "Cannot allocate latency buffer\n");
+                free(text);
+                return -1;
+            }
+            res->latencies = l;
+        }
+        res->latencies[res->count++] =
+            strtol(key + strlen("\"latency_us\":"), &p, 10);
+
+        key = strstr(p, "\"xruns\":");
+        if (key)
+            res->xruns += strtoul(key + strlen("\"xruns\":"), &p, 10);
+    }
+
+    free(text);
+
+    if (res->count < MIN_SAMPLES) {
+        fprintf(stderr, "%s has %u triggers, need at least %d\n", res->path,
+                res->count, MIN_SAMPLES);
+        return -1;
+    }
+
+    qsort(res->latencies, res->count, sizeof *res->latencies,
+          stats_compare_long);
+
+    return 0;
+}
+
+static long percentile(struct result *res, unsigned int p)
+{
+    return stats_percentile(res->latencies, res->count, p);
+}
+
+/* number of triggers slower than 'limit' */
+static unsigned int count_above(struct result *res, long limit)
+{
+    unsigned int n = 0;
+
+    while (n < res->count && res->latencies[res->count - 1 - n] > limit)
+        n++;
+
+    return n;
+}
+
+static double change(long base, long cand)
+{
+    return (base > 0) ? 100.0 * (cand - base) / base : 0;
+}
+
+static double mean(struct result *res)
+{
+    double total = 0;
+    unsigned int i;
+
+    for (i = 0; i < res->count; i++)
+        total += res->latencies[i];
+
+    return total / res->count;
+}
+
+/*
+ * One-sided Mann-Whitney U test using the normal approximation with tie and
+ * continuity correction. Returns the p-value for the hypothesis that the
+ * candidate latencies are stochastically larger than the baseline ones.
+ */
+static double mann_whitney(struct result *base, struct result *cand)
+{
+    struct rank *r;
+    unsigned int i, j, n = base->count + cand->count;
+    double rank_sum = 0, ties = 0, u, mu, sigma, z;
+
+    r = malloc(n * sizeof *r);
+    if (!r) {
+        fprintf(stderr, "Cannot allocate rank buffer\n");
+        return 1.0;
+    }
+    for (i = 0; i < base->count; i++)
+        r[i] = (struct rank){ base->latencies[i], 0 };
+    for (i = 0; i < cand->count; i++)
+        r[base->count + i] = (struct rank){ cand->latencies[i], 1 };
+    qsort(r, n, sizeof *r, compare_rank);
+
+    /* tied values share the average of the ranks they span */
+    for (i = 0; i < n; i = j) {
+        double t;
+
+        for (j = i + 1; j < n && r[j].value == r[i].value; j++)
+            ;
+        t = j - i;
+        ties += t * t * t - t;
+        while (i < j) {
+            if (r[i].candidate)
+                rank_sum += (i + j + 1) / 2.0;
+            i++;
+        }
+    }
+    free(r);
+
+    u = rank_sum - cand->count * (cand->count + 1) / 2.0;
+    mu = base->count * (double)cand->count / 2.0;
+    sigma = sqrt(base->count * (double)cand->count / 12.0 *
+                 ((n + 1) - ties / ((double)n * (n - 1))));
+    if (sigma == 0)
+        return 1.0; // every sample identical
+
+    z = (u - mu - 0.5) / sigma;
+
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+/*
+ * One-sided test for a higher per-trigger rate of events in the candidate.
+ * Conditioned on the total number of events, the candidate's share is
+ * binomial with p = its share of the triggers when both rates are equal.
+ * Returns the p-value of seeing at least cand_events in the candidate.
+ */
+static double rate_test(unsigned int base_events, unsigned int base_count,
+                        unsigned int cand_events, unsigned int cand_count)
+{
+    unsigned int i, k = base_events + cand_events;
+    double p = (double)cand_count / (base_count + cand_count), sum = 0;
+
+    if (cand_events == 0)
+        return 1.0;
+
+    for (i = cand_events; i <= k; i++)
+        sum += exp(lgamma(k + 1.0) - lgamma(i + 1.0) - lgamma(k - i + 1.0) +
+                   i * log(p) + (k - i) * log1p(-p));
+
+    return (sum > 1.0) ? 1.0 : sum;
+}
+
+static void print_row(char *name, double base, double cand)
+{
+    printf("%-8s %12.0f %12.0f", name, base, cand);
+    if (base > 0)
+        printf(" %+9.1f%%", 100.0 * (cand - base) / base);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct result base = { 0 }, cand = { 0 };
+    double alpha = DEFAULT_ALPHA, threshold = DEFAULT_THRESHOLD;
+    double tail_threshold = DEFAULT_TAIL_THRESHOLD;
+    double p_value, p_tail, p_xruns, median_change, tail_change;
+    long base_p99;
+    int opt, regression = 0;
+
+    while ((opt = getopt(argc, argv, "a:t:T:")) != -1) {
+        switch (opt) {
+        case 'a':
+            alpha = atof(optarg);
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'T':
+            tail_threshold = atof(optarg);
+            break;
+        case '?':
+        /* fall though */
+        default:
+            fprintf(stderr, "unknown/invalid option: '-%c'\n", optopt);
+            exit(2);
+        }
+    }
+
+    if (argc - optind != 2) {
+        printf("Usage: %s [-a significance level] [-t threshold] "
+               "[-T tail threshold] baseline.json candidate.json\n",
+               argv[0]);
+        printf("  (-a) significance level of the tests, defaults to "
+               "%.2f\n", DEFAULT_ALPHA);
+        printf("  (-t) minimum median increase in percent, defaults to "
+               "%.1f\n", DEFAULT_THRESHOLD);
+        printf("  (-T) minimum p99 increase in percent, defaults to "
+               "%.1f\n", DEFAULT_TAIL_THRESHOLD);
+        exit(2);
+    }
+
+    base.path = argv[optind];
+    cand.path = argv[optind + 1];
+    if (read_result(&base) || read_result(&cand))
+        exit(2);
+
+    printf("%-8s %12s %12s %10s\n", "latency", "baseline", "candidate",
+           "change");
+    print_row("min", base.latencies[0], cand.latencies[0]);
+    print_row("p50", percentile(&base, 50), percentile(&cand, 50));
+    print_row("p90", percentile(&base, 90), percentile(&cand, 90));
+    print_row("p99", percentile(&base, 99), percentile(&cand, 99));
+    print_row("max", base.latencies[base.count - 1],
+              cand.latencies[cand.count - 1]);
+    print_row("mean", mean(&base), mean(&cand));
+    printf("%-8s %12u %12u\n", "xruns", base.xruns, cand.xruns);
+    printf("%-8s %12u %12u\n", "triggers", base.count, cand.count);
+
+    p_value = mann_whitney(&base, &cand);
+    median_change = change(percentile(&base, 50), percentile(&cand, 50));
+    printf("\nMann-Whitney p = %.4g, median change %+.1f%%\n", p_value,
+           median_change);
+
+    base_p99 = percentile(&base, 99);
+    p_tail = rate_test(count_above(&base, base_p99), base.count,
+                       count_above(&cand, base_p99), cand.count);
+    tail_change = change(base_p99, percentile(&cand, 99));
+    printf("Tail test p = %.4g, p99 change %+.1f%%\n", p_tail, tail_change);
+
+    p_xruns = rate_test(base.xruns, base.count, cand.xruns, cand.count);
+    printf("Underrun test p = %.4g, %.3f -> %.3f per trigger\n", p_xruns,
+           (double)base.xruns / base.count, (double)cand.xruns / cand.count);
+
+    if (p_value < alpha && median_change >= threshold) {
+        printf("REGRESSION: latency increased significantly\n");
+        regression = 1;
+    }
+    if (p_tail < alpha && tail_change >= tail_threshold) {
+        printf("REGRESSION: tail latency increased significantly\n");
+        regression = 1;
+    }
+    if (base.xruns == 0 && cand.xruns > 0) {
+        printf("REGRESSION: underruns appeared\n");
+        regression = 1;
+    } else if (p_xruns < alpha) {
+        printf("REGRESSION: underruns per trigger increased significantly\n");
+        regression = 1;
+    }
+    if (!regression)
+        printf("No regression\n");
+
+    free(base.latencies);
+    free(cand.latencies);
+
+    return regression;
+}
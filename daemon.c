@@ -0,0 +1,371 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "alsa_play.h"
+#include "daemon.h"
+#include "results.h"
+
+/* listening socket plus this many simultaneous clients */
+#define MAX_CLIENTS 8
+
+/*
+ * pfd[] holds the listening socket, then up to MAX_PCM_FDS PCM descriptors,
+ * then the clients. Unused PCM slots, and all of them while idle, are -1.
+ */
+#define MAX_PCM_FDS 4
+#define FIRST_CLIENT (1 + MAX_PCM_FDS)
+
+/* give up on a stream if the PCM hasn't asked for frames in this long */
+#define PCM_TIMEOUT_MS 1000
+
+/* set from the signal handler to leave the event loop */
+static volatile sig_atomic_t quit;
+
+/* latency of the most recent play and the underrun count when it started */
+static long play_latency;
+static unsigned int play_xruns;
+
+/*
+ * A finished play is held here and only stored with results_add() once the
+ * daemon is idle, or once the next play's first period is written and
+ * answered, since growing the store may realloc the whole history.
+ */
+static int pending;
+static long pending_latency;
+static unsigned int pending_xruns;
+
+static void daemon_signal(int sig)
+{
+    quit = 1;
+}
+
+static void flush_play(void)
+{
+    if (pending)
+        results_add(pending_latency, pending_xruns);
+    pending = 0;
+}
+
+static void end_play(void)
+{
+    /* normally stored already, right after this play's first period */
+    flush_play();
+
+    pending = 1;
+    pending_latency = play_latency;
+    pending_xruns = alsa_xruns() - play_xruns;
+}
+
+/*
+ * Replies cost O(1) while a stream is playing. Percentiles need a sort of the
+ * whole history, so only an idle STATS computes them.
+ */
+static void send_response(int fd, uint8_t cmd, int status, int playing)
+{
+    struct daemon_response rsp;
+    struct results_summary summary;
+
+    if (fd < 0)
+        return;
+
+    if (cmd == DAEMON_CMD_STATS && !playing) {
+        flush_play();
+        results_summarize(&summary);
+    } else {
+        results_running(&summary);
+    }
+
+    memset(&rsp, 0, sizeof rsp);
+    rsp.cmd = cmd;
+    rsp.status = (status < 0) ? -1 : 0;
+    rsp.playing = playing;
+    rsp.plays = summary.count;
+    rsp.xruns = alsa_xruns();
+    rsp.last_us = play_latency;
+    rsp.min_us = summary.min_us;
+    rsp.max_us = summary.max_us;
+    rsp.mean_us = summary.mean_us;
+    rsp.p50_us = summary.p50_us;
+    rsp.p99_us = summary.p99_us;
+
+    if (send(fd, &rsp, sizeof rsp, MSG_NOSIGNAL) < 0)
+        fprintf(stderr, "Failed to send response: %s\n", strerror(errno));
+}
+
+/*
+ * Remove a socket file left behind by a daemon that is gone. Anything that
+ * isn't a socket, or a socket another daemon still answers on, is left alone
+ * and makes startup fail.
+ */
+static int remove_stale_socket(struct sockaddr_un *addr)
+{
+    int fd, ret;
+    struct stat st;
+
+    if (lstat(addr->sun_path, &st) < 0) {
+        if (errno == ENOENT)
+            return 0;
+        fprintf(stderr, "Cannot stat %s: %s\n", addr->sun_path,
+                strerror(errno));
+        return -errno;
+    }
+
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s exists and is not a socket\n", addr->sun_path);
+        return -EEXIST;
+    }
+
+    /* a refused connection means nobody is listening any more */
+    fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+        return -errno;
+    }
+    ret = connect(fd, (struct sockaddr *)addr, sizeof *addr);
+    if (ret == 0) {
+        fprintf(stderr, "Another daemon is listening on %s\n", addr->sun_path);
+        close(fd);
+        return -EADDRINUSE;
+    }
+    ret = -errno;
+    close(fd);
+    if (ret != -ECONNREFUSED) {
+        fprintf(stderr, "Cannot probe %s: %s\n", addr->sun_path,
+                strerror(-ret));
+        return ret;
+    }
+
+    if (unlink(addr->sun_path) < 0) {
+        fprintf(stderr, "Cannot remove stale socket %s: %s\n", addr->sun_path,
+                strerror(errno));
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int open_socket(char *socket_path)
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (remove_stale_socket(&addr) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+        fprintf(stderr, "Cannot bind %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, MAX_CLIENTS) < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socket_path,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Serve play/stop/stats requests until SIGINT or SIGTERM. PCM and sample data
+ * must already be set up by alsa_init(), so a PLAY only costs a rewind and a
+ * period write. The PCM is polled together with the sockets, so a command is
+ * picked up as soon as it arrives, even mid-stream, and its latency is timed
+ * from when poll() woke up.
+ */
+int daemon_run(char *socket_path)
+{
+    struct pollfd pfd[FIRST_CLIENT + MAX_CLIENTS];
+    struct sigaction sa;
+    struct timespec wake_time, play_time;
+    struct daemon_request req;
+    int i, n, ret, nfds, npcm, listen_fd;
+    int playing = 0, first_period = 0, requester = -1;
+
+    /* keep sample data and stacks resident so a play never page faults */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        fprintf(stderr, "Cannot lock memory: %s\n", strerror(errno));
+
+    /* no SA_RESTART, so poll() returns EINTR and the loop can exit */
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    listen_fd = open_socket(socket_path);
+    if (listen_fd < 0)
+        return -1;
+
+    pfd[0].fd = listen_fd;
+    pfd[0].events = POLLIN;
+    for (i = 1; i < FIRST_CLIENT; i++)
+        pfd[i].fd = -1;
+    nfds = FIRST_CLIENT;
+
+    npcm = alsa_poll_descriptors(&pfd[1], MAX_PCM_FDS);
+    if (npcm < 0) {
+        close(listen_fd);
+        unlink(socket_path);
+        return -1;
+    }
+
+    printf("Listening on %s\n", socket_path);
+
+    while (!quit) {
+        /* only wait on the PCM while it has a stream to feed */
+        if (playing)
+            alsa_poll_descriptors(&pfd[1], npcm);
+        else
+            for (i = 1; i <= npcm; i++)
+                pfd[i].fd = -1;
+
+        n = poll(pfd, nfds, playing ? PCM_TIMEOUT_MS : -1);
+        clock_gettime(CLOCK_MONOTONIC, &wake_time);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            fprintf(stderr, "PCM timeout occurred\n");
+            alsa_stop();
+            end_play();
+            playing = 0;
+            continue;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && nfds < FIRST_CLIENT + MAX_CLIENTS) {
+                pfd[nfds].fd = fd;
+                pfd[nfds].events = POLLIN;
+                pfd[nfds].revents = 0;
+                nfds++;
+            } else if (fd >= 0) {
+                fprintf(stderr, "Too many clients, dropping connection\n");
+                close(fd);
+            }
+        }
+
+        for (i = FIRST_CLIENT; i < nfds; i++) {
+            if (!pfd[i].revents)
+                continue;
+
+            if (recv(pfd[i].fd, &req, sizeof req, 0) != sizeof req) {
+                /* hung up or sent garbage */
+                if (pfd[i].fd == requester)
+                    requester = -1;
+                close(pfd[i].fd);
+                pfd[i] = pfd[--nfds];
+                i--;
+                continue;
+            }
+
+            switch (req.cmd) {
+            case DAEMON_CMD_PLAY:
+                /* a play still waiting on its first period is superseded */
+                if (first_period)
+                    send_response(requester, DAEMON_CMD_PLAY, -1, 0);
+                else if (playing)
+                    end_play();
+                ret = alsa_start();
+                if (ret) {
+                    send_response(pfd[i].fd, req.cmd, ret, 0);
+                    playing = first_period = 0;
+                    break;
+                }
+                play_time = wake_time;
+                play_xruns = alsa_xruns();
+                requester = pfd[i].fd;
+                playing = first_period = 1;
+                break;
+            case DAEMON_CMD_STOP:
+                if (playing)
+                    alsa_stop();
+                if (first_period)
+                    send_response(requester, DAEMON_CMD_PLAY, -1, 0);
+                else if (playing)
+                    end_play();
+                playing = first_period = 0;
+                send_response(pfd[i].fd, req.cmd, 0, 0);
+                break;
+            case DAEMON_CMD_STATS:
+                send_response(pfd[i].fd, req.cmd, 0, playing);
+                break;
+            default:
+                send_response(pfd[i].fd, req.cmd, -EINVAL, playing);
+                break;
+            }
+        }
+
+        if (!playing) {
+            flush_play();
+            continue;
+        }
+
+        /* a new stream is fed at once, otherwise wait for the PCM */
+        if (!first_period && alsa_poll_ready(&pfd[1], npcm) <= 0)
+            continue;
+
+        ret = alsa_play_period();
+
+        if (first_period) {
+            first_period = 0;
+            if (ret < 0) {
+                send_response(requester, DAEMON_CMD_PLAY, ret, 0);
+                playing = 0;
+                continue;
+            }
+            play_latency = alsa_latency_us(&play_time);
+            send_response(requester, DAEMON_CMD_PLAY, ret, ret > 0);
+
+            /* back to back plays never go idle, store the previous one */
+            flush_play();
+        }
+
+        if (ret <= 0) {
+            end_play();
+            playing = 0;
+        }
+    }
+
+    if (playing && !first_period)
+        end_play();
+    flush_play();
+
+    for (i = FIRST_CLIENT; i < nfds; i++)
+        close(pfd[i].fd);
+    close(listen_fd);
+    unlink(socket_path);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+/*
+ * Control protocol spoken over the daemon's SOCK_SEQPACKET Unix socket.
+ * Every request is a single struct daemon_request and is answered by a single
+ * struct daemon_response. Both are in host byte order.
+ *
+ * PLAY  rewinds the sample and starts playback; the reply is sent once the
+ *       first period has been written and carries that play's latency.
+ * STOP  drops any queued audio.
+ * STATS reports latency statistics without touching playback.
+ */
+#define DAEMON_CMD_PLAY  1
+#define DAEMON_CMD_STOP  2
+#define DAEMON_CMD_STATS 3
+
+struct daemon_request {
+    uint8_t cmd;
+};
+
+/*
+ * All latencies are in microseconds, command received to sound at the DAC as
+ * measured by alsa_latency_us(). plays, min, max and mean cover finished
+ * plays; last_us includes the play in progress. p50 and p99 are only filled in
+ * by a STATS sent while idle.
+ */
+struct daemon_response {
+    uint8_t cmd;      /* command being answered */
+    int8_t status;    /* 0 on success, negative on error */
+    uint16_t playing; /* 1 while a stream is active */
+    uint32_t plays;   /* number of latency samples */
+    uint32_t xruns;   /* underruns since startup */
+    uint32_t last_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t mean_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+};
+
+int daemon_run(char *socket_path);
+
+#endif /* DAEMON_H */
@@ -4,9 +4,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <poll.h>
 
 #include "alsa_play.h"
+#include "daemon.h"
+#include "resample.h"
+#include "results.h"
 
 #define GPIO_IN  249
 #define GPIO_OUT 247
@@ -26,17 +30,73 @@ void print_instructions(void)
     printf("---------------------------------------------------------------\n");
 }
 
+/*
+ * Play the sample once and record its latency, as measured by
+ * alsa_latency_us() from the trigger time.
+ */
+int play_trigger(struct timespec *trigger_time)
+{
+    int ret;
+    unsigned int xruns;
+    long latency;
+
+    xruns = alsa_xruns();
+
+    ret = alsa_start();
+    if (ret)
+        return ret;
+
+    ret = alsa_play_period();
+    if (ret < 0)
+        return ret;
+
+    latency = alsa_latency_us(trigger_time);
+    printf("Trigger to sound latency = %ld us\n", latency);
+
+#ifdef FTRACE
+    exit(-1); // bail after one write
+#endif
+
+    while (ret > 0)
+        ret = alsa_play_period();
+
+    /* keep the latency of a stream that failed later, but report both */
+    if (results_add(latency, alsa_xruns() - xruns) < 0)
+        return -1;
+
+    return ret;
+}
+
+void print_summary(void)
+{
+    struct results_summary summary;
+
+    results_summarize(&summary);
+    if (summary.count == 0)
+        return;
+
+    printf("%u triggers, %u xruns, latency min %ld us, p50 %ld us, "
+           "p90 %ld us, p99 %ld us, max %ld us\n",
+           summary.count, summary.xruns, summary.min_us, summary.p50_us,
+           summary.p90_us, summary.p99_us, summary.max_us);
+}
+
 int main(int argc, char *argv[])
 {
     char str[256], buf[8];
     char *wav_file = NULL;
     char *alsa_device = NULL;
+    char *socket_path = NULL;
+    char *results_file = NULL;
     struct pollfd pfd;
+    struct timespec trigger_time;
     int opt, gpio_trigger_fd, gpio_response_fd;
     int gpio_trigger = -1, gpio_response = -1;
     int period = -1;
+    int i, triggers = 1, status = 0;
+    int quality = RESAMPLE_MEDIUM, stream = 0;
 
-    while ((opt = getopt(argc, argv, "f:g:r:d:p:")) != -1) {
+    while ((opt = getopt(argc, argv, "f:g:r:d:p:s:o:n:q:S")) != -1) {
         switch (opt) {
         case 'f':
             wav_file = strdup(optarg);
@@ -54,6 +114,30 @@ int main(int argc, char *argv[])
         case 'd':
             alsa_device = strdup(optarg);
             break;
+        case 's':
+            socket_path = strdup(optarg);
+            break;
+        case 'o':
+            results_file = strdup(optarg);
+            break;
+        case 'n':
+            triggers = atoi(optarg);
+            if (triggers < 1) {
+                fprintf(stderr, "number of triggers must be at least 1\n");
+                exit(-1);
+            }
+            break;
+        case 'q':
+            quality = atoi(optarg);
+            if (quality < RESAMPLE_FASTEST || quality > RESAMPLE_BEST) {
+                fprintf(stderr, "resampler quality must be %d to %d\n",
+                        RESAMPLE_FASTEST, RESAMPLE_BEST);
+                exit(-1);
+            }
+            break;
+        case 'S':
+            stream = 1;
+            break;
         case '?':
         /* fall though */
         default:
@@ -62,18 +146,50 @@ int main(int argc, char *argv[])
         }
     }
 
-    if ((wav_file == NULL) | (gpio_trigger == -1)) {
+    if ((wav_file == NULL) | ((gpio_trigger == -1) & (socket_path == NULL))) {
         printf("Usage: %s -f path/to/file.wav -g trigger GPIO [-r response "
-               "GPIO] [-d ALSA device name] [-p period size]\n",
+               "GPIO] [-d ALSA device name] [-p period size] [-n triggers] "
+               "[-o results.json] [-q quality] [-S]\n",
                argv[0]);
-        printf("  (-f) wav file must be 32-bits 48 kHz\n");
+        printf("       %s -f path/to/file.wav -s socket path [-d ALSA device "
+               "name] [-p period size] [-o results.json] [-q quality] [-S]\n",
+               argv[0]);
+        printf("  (-f) wav file must be 32-bits stereo, other rates than the "
+               "device's are resampled\n");
         printf("  (-g) exported GPIO number to use as sound trigger\n");
         printf("  (-r) exported GPIO number to use as trigger response\n");
         printf("  (-d) ALSA device name\n");
         printf("  (-p) period size is specified in frames\n");
+        printf("  (-s) run as a daemon controlled through this Unix socket\n");
+        printf("  (-n) number of GPIO triggers to measure, defaults to 1\n");
+        printf("  (-o) write parameters and latencies to this JSON file\n");
+        printf("  (-q) resampler quality, 0 (fastest) to 3 (best), defaults "
+               "to 2\n");
+        printf("  (-S) stream the file and resample one period at a time "
+               "instead of at load\n");
         exit(-1);
     }
 
+    if (socket_path != NULL) {
+        if (alsa_init(alsa_device, wav_file, period, quality, stream) != 0) {
+            printf("alsa init failed\n");
+            exit(-1);
+        }
+
+        if (daemon_run(socket_path) != 0)
+            exit(-1);
+
+        /* a run without its record must fail, it may be gating an upgrade */
+        print_summary();
+        if (results_file != NULL &&
+            results_write(results_file, alsa_get_params()) != 0)
+            status = -1;
+
+        alsa_deinit();
+        results_free();
+        return status;
+    }
+
     sprintf(str, "/sys/class/gpio/gpio%d/value", gpio_trigger);
     if ((gpio_trigger_fd = open(str, O_RDONLY)) < 0) {
         fprintf(stderr, "Failed, gpio %d not exported.\n", gpio_trigger);
@@ -90,7 +206,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (alsa_init(alsa_device, wav_file, period) != 0) {
+    if (alsa_init(alsa_device, wav_file, period, quality, stream) != 0) {
         printf("alsa init failed\n");
         exit(-1);
     }
@@ -102,30 +218,40 @@ int main(int argc, char *argv[])
     lseek(gpio_trigger_fd, 0, SEEK_SET);
     read(gpio_trigger_fd, buf, sizeof buf);
 
-    /* wait for interrupt */
-    poll(&pfd, 1, -1);
+    for (i = 0; i < triggers; i++) {
+        /* wait for interrupt */
+        poll(&pfd, 1, -1);
+        clock_gettime(CLOCK_MONOTONIC, &trigger_time);
 
-    /* interrupt triggered: toggle response GPIO and play audio */
-    printf("GPIO triggered\n");
+        /* interrupt triggered: toggle response GPIO and play audio */
+        printf("GPIO triggered\n");
 
-    if (gpio_response > 0)
-        write(gpio_response_fd, "1", 1);
+        if (gpio_response > 0)
+            write(gpio_response_fd, "1", 1);
 
-    alsa_play();
+        if (play_trigger(&trigger_time) < 0)
+            status = -1;
 
-    if (gpio_response > 0)
-        write(gpio_response_fd, "0", 1);
+        if (gpio_response > 0)
+            write(gpio_response_fd, "0", 1);
 
-    /* consume interrupt */
-    lseek(gpio_trigger_fd, 0, SEEK_SET);
-    read(gpio_trigger_fd, buf, sizeof buf);
+        /* consume interrupt */
+        lseek(gpio_trigger_fd, 0, SEEK_SET);
+        read(gpio_trigger_fd, buf, sizeof buf);
+    }
+
+    print_summary();
+    if (results_file != NULL &&
+        results_write(results_file, alsa_get_params()) != 0)
+        status = -1;
 
     alsa_deinit();
+    results_free();
 
     close(gpio_trigger_fd);
 
     if (gpio_response > 0)
         close(gpio_response_fd);
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> /* memcpy() */
+
+#include "resample.h"
+
+/*
+ * Polyphase windowed-sinc sample rate converter.
+ *
+ * The rate ratio is reduced to up / down. Output frame n sits at input time
+ * n * down / up. Its integer part selects the input window and its fractional
+ * part (a multiple of 1 / up) selects one of up precomputed filter phases,
+ * so each output sample is a single dot product of 'taps' coefficients with
+ * 'taps' input samples.
+ *
+ * Samples are kept per channel as floats in a small FIFO so the dot product
+ * runs over contiguous memory with 4-wide vector arithmetic. GCC's generic
+ * vector extension compiles this to SSE on x86-64 and NEON on arm64. 32-bit
+ * ARM needs the NEON flags the Makefile adds on armv7l, and ARMv6 boards
+ * without NEON get scalar code.
+ */
+
+/* filter phases are precomputed, so refuse ratios that would need too many */
+#define MAX_PHASES 1024
+
+/* input frames converted into the FIFO per refill */
+#define CHUNK_FRAMES 256
+
+#define VECTOR_WIDTH 4
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+struct resample_quality {
+    unsigned int taps; /* filter length when not downsampling */
+    double beta;       /* Kaiser window shape, higher for more stopband */
+    double rolloff;    /* cutoff as a fraction of the lower Nyquist rate */
+};
+
+static const struct resample_quality qualities[] = {
+    [RESAMPLE_FASTEST] = { 8, 5.0, 0.80 },
+    [RESAMPLE_LOW] = { 16, 7.0, 0.88 },
+    [RESAMPLE_MEDIUM] = { 32, 8.6, 0.93 },
+    [RESAMPLE_BEST] = { 64, 10.0, 0.96 },
+};
+
+struct resampler {
+    unsigned int channels;
+    unsigned int up, down;
+    unsigned int taps;
+    unsigned int phase; /* fractional input position, in 1 / up units */
+    float *filter;      /* up rows of taps coefficients */
+    float *fifo;        /* channels rows of fifo_len samples */
+    unsigned int fifo_len;
+    unsigned int rd, wr; /* valid samples are fifo[rd, wr) */
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    unsigned int t;
+
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* zeroth order modified Bessel function of the first kind */
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k = 1; term > 1e-12 * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static void design_filter(struct resampler *r, const struct resample_quality *q)
+{
+    unsigned int p, k, half = r->taps / 2;
+    double fc, t, x, h, sum;
+    float *row;
+
+    /* cut off below the lower of the two Nyquist rates */
+    fc = q->rolloff * ((r->up < r->down) ? (double)r->up / r->down : 1.0);
+
+    for (p = 0; p < r->up; p++) {
+        row = r->filter + p * r->taps;
+        sum = 0;
+        for (k = 0; k < r->taps; k++) {
+            /* distance from the output instant, in input samples */
+            t = (double)k - (half - 1) - (double)p / r->up;
+            x = t / half;
+            h = (t == 0) ? fc : sin(M_PI * fc * t) / (M_PI * t);
+            h *= (x * x < 1) ? bessel_i0(q->beta * sqrt(1 - x * x)) /
+                                   bessel_i0(q->beta)
+                             : 0;
+            row[k] = h;
+            sum += h;
+        }
+
+        /* unity gain at DC for every phase */
+        for (k = 0; k < r->taps; k++)
+            row[k] /= sum;
+    }
+}
+
+struct resampler *resampler_create(unsigned int in_rate, unsigned int out_rate,
+                                   unsigned int channels, int quality)
+{
+    struct resampler *r;
+    const struct resample_quality *q;
+    unsigned int g, stretch;
+
+    if (quality < RESAMPLE_FASTEST || quality > RESAMPLE_BEST) {
+        fprintf(stderr, "Invalid resampler quality %d\n", quality);
+        return NULL;
+    }
+    q = &qualities[quality];
+
+    if (in_rate == 0 || out_rate == 0 || channels == 0) {
+        fprintf(stderr, "Invalid resampler rates %u -> %u Hz\n", in_rate,
+                out_rate);
+        return NULL;
+    }
+
+    g = gcd(in_rate, out_rate);
+    if (out_rate / g > MAX_PHASES) {
+        fprintf(stderr, "Can't resample %u -> %u Hz, ratio needs %u phases\n",
+                in_rate, out_rate, out_rate / g);
+        return NULL;
+    }
+
+    r = calloc(1, sizeof *r);
+    if (!r) {
+        fprintf(stderr, "Cannot allocate resampler: %s\n", strerror(ENOMEM));
+        return NULL;
+    }
+
+    r->channels = channels;
+    r->up = out_rate / g;
+    r->down = in_rate / g;
+
+    /* a narrower cutoff needs a proportionally longer filter */
+    stretch = (r->down + r->up - 1) / r->up;
+    r->taps = q->taps * stretch;
+    r->taps = (r->taps + VECTOR_WIDTH - 1) / VECTOR_WIDTH * VECTOR_WIDTH;
+
+    r->fifo_len = r->taps + CHUNK_FRAMES;
+    r->filter = malloc(r->up * r->taps * sizeof *r->filter);
+    r->fifo = malloc(channels * r->fifo_len * sizeof *r->fifo);
+    if (!r->filter || !r->fifo) {
+        fprintf(stderr, "Cannot allocate resampler filter: %s\n",
+                strerror(ENOMEM));
+        resampler_free(r);
+        return NULL;
+    }
+
+    design_filter(r, q);
+    resampler_reset(r);
+
+    return r;
+}
+
+/* forget all buffered input, as if nothing had been processed yet */
+void resampler_reset(struct resampler *r)
+{
+    unsigned int ch;
+
+    /* lead-in silence so output frame 0 lines up with input frame 0 */
+    for (ch = 0; ch < r->channels; ch++)
+        memset(r->fifo + ch * r->fifo_len, 0,
+               (r->taps / 2 - 1) * sizeof *r->fifo);
+    r->rd = 0;
+    r->wr = r->taps / 2 - 1;
+    r->phase = 0;
+}
+
+/* number of output frames that correspond to in_frames of input */
+long resampler_output_frames(struct resampler *r, long in_frames)
+{
+    return ((long long)in_frames * r->up + r->down - 1) / r->down;
+}
+
+unsigned int resampler_taps(struct resampler *r)
+{
+    return r->taps;
+}
+
+/*
+ * Move the unread samples to the front of the FIFO and append up to
+ * 'frames' interleaved input frames, or silence when in is NULL.
+ * Returns the number of frames appended.
+ */
+static long refill(struct resampler *r, const int32_t *in, long frames)
+{
+    unsigned int ch, i, n;
+    float *row;
+
+    n = r->fifo_len - (r->wr - r->rd);
+    if (frames < n)
+        n = frames;
+
+    for (ch = 0; ch < r->channels; ch++) {
+        row = r->fifo + ch * r->fifo_len;
+        memmove(row, row + r->rd, (r->wr - r->rd) * sizeof *row);
+        row += r->wr - r->rd;
+        for (i = 0; i < n; i++)
+            row[i] = in ? in[i * r->channels + ch] * (1.0f / 2147483648.0f)
+                        : 0;
+    }
+    r->wr -= r->rd;
+    r->rd = 0;
+    r->wr += n;
+
+    return n;
+}
+
+static float dot(const float *a, const float *b, unsigned int n)
+{
+    v4sf acc0 = { 0 }, acc1 = { 0 }, va, vb;
+    unsigned int i = 0;
+
+    /* two accumulators hide the latency of the vector multiply-add */
+    for (; i + 2 * VECTOR_WIDTH <= n; i += 2 * VECTOR_WIDTH) {
+        memcpy(&va, a + i, sizeof va);
+        memcpy(&vb, b + i, sizeof vb);
+        acc0 += va * vb;
+        memcpy(&va, a + i + VECTOR_WIDTH, sizeof va);
+        memcpy(&vb, b + i + VECTOR_WIDTH, sizeof vb);
+        acc1 += va * vb;
+    }
+    for (; i < n; i += VECTOR_WIDTH) {
+        memcpy(&va, a + i, sizeof va);
+        memcpy(&vb, b + i, sizeof vb);
+        acc0 += va * vb;
+    }
+    acc0 += acc1;
+
+    return acc0[0] + acc0[1] + acc0[2] + acc0[3];
+}
+
+static int32_t to_s32(float sample)
+{
+    double v = sample * 2147483648.0;
+
+    if (v >= 2147483647.0)
+        return INT32_MAX;
+    if (v <= -2147483648.0)
+        return INT32_MIN;
+
+    return (int32_t)v;
+}
+
+/*
+ * Convert interleaved S32 frames. Consumes up to in_frames from 'in' and
+ * produces up to out_frames into 'out'; state carries over between calls so
+ * a stream can be fed in arbitrary pieces. Pass in = NULL to feed silence
+ * and flush the tail of the filter. Returns the number of frames produced
+ * and stores the number of input frames consumed in in_used.
+ */
+long resampler_process(struct resampler *r, const int32_t *in, long in_frames,
+                       long *in_used, int32_t *out, long out_frames)
+{
+    const float *coeffs;
+    long used = 0, produced = 0;
+    unsigned int ch;
+
+    while (produced < out_frames) {
+        if (r->wr - r->rd < r->taps) {
+            if (in == NULL)
+                refill(r, NULL, CHUNK_FRAMES);
+            else if (used < in_frames)
+                used += refill(r, in + used * r->channels, in_frames - used);
+            else
+                break;
+            continue;
+        }
+
+        coeffs = r->filter + r->phase * r->taps;
+        for (ch = 0; ch < r->channels; ch++)
+            out[produced * r->channels + ch] =
+                to_s32(dot(coeffs, r->fifo + ch * r->fifo_len + r->rd, r->taps));
+        produced++;
+
+        /* step the input position by down / up samples */
+        r->phase += r->down;
+        while (r->phase >= r->up) {
+            r->phase -= r->up;
+            r->rd++;
+        }
+    }
+
+    if (in_used)
+        *in_used = used;
+
+    return produced;
+}
+
+void resampler_free(struct resampler *r)
+{
+    if (!r)
+        return;
+
+    free(r->filter);
+    free(r->fifo);
+    free(r);
+}
@@ -0,0 +1,23 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+/* resampler quality levels, trading filter length for speed */
+#define RESAMPLE_FASTEST 0
+#define RESAMPLE_LOW     1
+#define RESAMPLE_MEDIUM  2
+#define RESAMPLE_BEST    3
+
+struct resampler;
+
+struct resampler *resampler_create(unsigned int in_rate, unsigned int out_rate,
+                                   unsigned int channels, int quality);
+void resampler_reset(struct resampler *r);
+long resampler_output_frames(struct resampler *r, long in_frames);
+long resampler_process(struct resampler *r, const int32_t *in, long in_frames,
+                       long *in_used, int32_t *out, long out_frames);
+unsigned int resampler_taps(struct resampler *r);
+void resampler_free(struct resampler *r);
+
+#endif /* RESAMPLE_H */
@@ -0,0 +1,128 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "resample.h"
+
+/*
+ * Resampler throughput at every quality level, converting a stereo 1 kHz
+ * tone both in one pass (load time) and one period at a time (streaming).
+ * SNR against an ideal tone at the output rate shows what each level buys.
+ */
+
+#define CHANNELS 2
+#define SECONDS 10
+#define TONE_HZ 1000.0
+#define AMPLITUDE 0.5
+#define PERIOD_FRAMES 128
+
+static const unsigned int in_rates[] = { 44100, 96000 };
+#define OUT_RATE 48000
+
+static const char *quality_names[] = { "fastest", "low", "medium", "best" };
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_tone(int32_t *buf, long frames, unsigned int rate)
+{
+    long i;
+    int32_t s;
+
+    for (i = 0; i < frames; i++) {
+        s = AMPLITUDE * 2147483647.0 * sin(2 * M_PI * TONE_HZ * i / rate);
+        buf[i * CHANNELS] = buf[i * CHANNELS + 1] = s;
+    }
+}
+
+/* ignore the first and last 10 ms where the filter runs into silence */
+static double snr_db(int32_t *buf, long frames)
+{
+    double ref, err, signal = 0, noise = 0;
+    long i, edge = OUT_RATE / 100;
+
+    for (i = edge; i < frames - edge; i++) {
+        ref = AMPLITUDE * sin(2 * M_PI * TONE_HZ * i / OUT_RATE);
+        err = buf[i * CHANNELS] / 2147483648.0 - ref;
+        signal += ref * ref;
+        noise += err * err;
+    }
+
+    return 10 * log10(signal / noise);
+}
+
+static long convert(struct resampler *r, int32_t *in, long in_frames,
+                    int32_t *out, long out_frames, long chunk)
+{
+    long used, done = 0, produced = 0, n;
+
+    while (produced < out_frames) {
+        n = (out_frames - produced < chunk) ? out_frames - produced : chunk;
+        n = resampler_process(r, (done < in_frames) ? in + done * CHANNELS
+                                                    : NULL,
+                              in_frames - done, &used,
+                              out + produced * CHANNELS, n);
+        done += used;
+        produced += n;
+    }
+
+    return produced;
+}
+
+int main(void)
+{
+    struct resampler *r;
+    int32_t *in, *out;
+    long in_frames, out_frames;
+    double start, load_s, stream_s;
+    unsigned int i;
+    int q;
+
+    printf("%-13s %-8s %5s %14s %14s %8s\n", "conversion", "quality",
+           "taps", "load (x rt)", "stream (x rt)", "SNR dB");
+
+    for (i = 0; i < sizeof in_rates / sizeof in_rates[0]; i++) {
+        in_frames = (long)in_rates[i] * SECONDS;
+        in = malloc(in_frames * CHANNELS * sizeof *in);
+        out = malloc(((long)OUT_RATE * SECONDS + 1) * CHANNELS * sizeof *out);
+        if (!in || !out) {
+            fprintf(stderr, "Cannot allocate benchmark buffers\n");
+            return -1;
+        }
+        make_tone(in, in_frames, in_rates[i]);
+
+        for (q = RESAMPLE_FASTEST; q <= RESAMPLE_BEST; q++) {
+            r = resampler_create(in_rates[i], OUT_RATE, CHANNELS, q);
+            if (!r)
+                return -1;
+            out_frames = resampler_output_frames(r, in_frames);
+
+            start = now_s();
+            convert(r, in, in_frames, out, out_frames, out_frames);
+            load_s = now_s() - start;
+
+            resampler_reset(r);
+            start = now_s();
+            convert(r, in, in_frames, out, out_frames, PERIOD_FRAMES);
+            stream_s = now_s() - start;
+
+            printf("%5u->%-5u   %-8s %5u %14.0f %14.0f %8.1f\n", in_rates[i],
+                   OUT_RATE, quality_names[q], resampler_taps(r),
+                   SECONDS / load_s, SECONDS / stream_s,
+                   snr_db(out, out_frames));
+
+            resampler_free(r);
+        }
+
+        free(in);
+        free(out);
+    }
+
+    return 0;
+}
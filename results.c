@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+#include "stats.h"
+
+/* per-trigger measurements, grown as triggers arrive */
+static long *latencies;
+static unsigned int *trigger_xruns;
+static unsigned int count;
+static unsigned int capacity;
+
+/* running statistics, so a summary without percentiles is O(1) */
+static long last_us;
+static long min_us;
+static long max_us;
+static long long total_us;
+static unsigned int total_xruns;
+
+long elapsed_us(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000L +
+           (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* record the command-to-sound latency and underruns of a finished trigger */
+int results_add(long latency_us, unsigned int xruns)
+{
+    long *l;
+    unsigned int *x;
+
+    if (count == capacity) {
+        capacity = capacity ? 2 * capacity : 64;
+        l = realloc(latencies, capacity * sizeof *latencies);
+        x = realloc(trigger_xruns, capacity * sizeof *trigger_xruns);
+        if (l)
+            latencies = l;
+        if (x)
+            trigger_xruns = x;
+        if (!l || !x) {
+            fprintf(stderr, "Cannot grow results buffer: %s\n",
+                    strerror(ENOMEM));
+            capacity = count;
+            return -ENOMEM;
+        }
+    }
+
+    latencies[count] = latency_us;
+    trigger_xruns[count] = xruns;
+
+    last_us = latency_us;
+    if (count == 0 || latency_us < min_us)
+        min_us = latency_us;
+    if (latency_us > max_us)
+        max_us = latency_us;
+    total_us += latency_us;
+    total_xruns += xruns;
+    count++;
+
+    return 0;
+}
+
+/* everything but the percentiles, cheap enough to call while playing */
+void results_running(struct results_summary *summary)
+{
+    memset(summary, 0, sizeof *summary);
+    if (count == 0)
+        return;
+
+    summary->count = count;
+    summary->xruns = total_xruns;
+    summary->last_us = last_us;
+    summary->min_us = min_us;
+    summary->max_us = max_us;
+    summary->mean_us = total_us / count;
+}
+
+/* full summary; sorts every recorded latency, so keep it off the hot path */
+void results_summarize(struct results_summary *summary)
+{
+    long *sorted;
+
+    results_running(summary);
+    if (count == 0)
+        return;
+
+    sorted = malloc(count * sizeof *sorted);
+    if (!sorted) {
+        fprintf(stderr, "Cannot allocate percentile buffer\n");
+        return;
+    }
+    memcpy(sorted, latencies, count * sizeof *sorted);
+    qsort(sorted, count, sizeof *sorted, stats_compare_long);
+
+    summary->p50_us = stats_percentile(sorted, count, 50);
+    summary->p90_us = stats_percentile(sorted, count, 90);
+    summary->p99_us = stats_percentile(sorted, count, 99);
+
+    free(sorted);
+}
+
+static void write_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; str && *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', fp);
+        if ((unsigned char)*str >= 0x20)
+            fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * Write the negotiated parameters, every trigger and the summary as a single
+ * JSON object. latency-compare reads the "triggers" array back.
+ */
+int results_write(char *path, const struct alsa_params *params)
+{
+    FILE *fp;
+    unsigned int i;
+    struct results_summary summary;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Cannot open results file %s: %s\n", path,
+                strerror(errno));
+        return -errno;
+    }
+
+    results_summarize(&summary);
+
+    fprintf(fp, "{\n  \"device\": ");
+    write_string(fp, params->device);
+    fprintf(fp, ",\n  \"hw_params\": {\"format\": ");
+    write_string(fp, params->format);
+    fprintf(fp,
+            ", \"channels\": %u, \"rate\": %u, \"period_size\": %lu, "
+            "\"buffer_size\": %lu, \"period_time_us\": %u},\n",
+            params->channels, params->rate, params->period_size,
+            params->buffer_size, params->period_time_us);
+    fprintf(fp,
+            "  \"sw_params\": {\"avail_min\": %lu, \"start_threshold\": %lu},\n",
+            params->avail_min, params->start_threshold);
+
+    fprintf(fp, "  \"triggers\": [");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "%s\n    {\"latency_us\": %ld, \"xruns\": %u}",
+                i ? "," : "", latencies[i], trigger_xruns[i]);
+    }
+    fprintf(fp, "%s],\n", count ? "\n  " : "");
+
+    fprintf(fp,
+            "  \"summary\": {\"count\": %u, \"xruns\": %u, \"min_us\": %ld, "
+            "\"max_us\": %ld, \"mean_us\": %ld, \"p50_us\": %ld, "
+            "\"p90_us\": %ld, \"p99_us\": %ld}\n}\n",
+            summary.count, summary.xruns, summary.min_us, summary.max_us,
+            summary.mean_us, summary.p50_us, summary.p90_us, summary.p99_us);
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing results file %s\n", path);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+void results_free(void)
+{
+    free(latencies);
+    free(trigger_xruns);
+    latencies = NULL;
+    trigger_xruns = NULL;
+    count = capacity = 0;
+    total_us = total_xruns = 0;
+    last_us = min_us = max_us = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <time.h>
+
+#include "alsa_play.h"
+
+/* latency statistics over all recorded triggers, in microseconds */
+struct results_summary {
+    unsigned int count;
+    unsigned int xruns;
+    long last_us;
+    long min_us;
+    long max_us;
+    long mean_us;
+    long p50_us;
+    long p90_us;
+    long p99_us;
+};
+
+long elapsed_us(struct timespec *start, struct timespec *end);
+int results_add(long latency_us, unsigned int xruns);
+void results_running(struct results_summary *summary);
+void results_summarize(struct results_summary *summary);
+int results_write(char *path, const struct alsa_params *params);
+void results_free(void);
+
+#endif /* RESULTS_H */
@@ -0,0 +1,20 @@
+#include "stats.h"
+
+/* qsort() comparator for ascending longs */
+int stats_compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Nearest-rank percentile of a sorted array. Shared by the results writer and
+ * latency-compare so both report the same p50/p90/p99 for the same data.
+ */
+long stats_percentile(const long *sorted, unsigned int n, unsigned int p)
+{
+    unsigned int rank = (p * n + 99) / 100;
+
+    return sorted[rank ? rank - 1 : 0];
+}
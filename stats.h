@@ -0,0 +1,7 @@
+#ifndef STATS_H
+#define STATS_H
+
+int stats_compare_long(const void *a, const void *b);
+long stats_percentile(const long *sorted, unsigned int n, unsigned int p);
+
+#endif /* STATS_H */